@@ -5,12 +5,24 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <map>
 #include <optional>
 #include <algorithm>
 #include <limits>
 #include <ctime>
+#include <cmath>
 #include <cstdlib>
 #include <cstring>
+#include <cstdint>
+#include <cctype>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <filesystem>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <optional>
 using namespace std;
 
@@ -153,6 +165,9 @@ struct User {
 
 const int MAX_LOAN_LIMIT = 5;
 const int LOAN_PERIOD_DAYS = 14;
+const int ARCHIVE_AFTER_DAYS = 30; // returned loans older than this leave the hot table
+const int FLUSH_MAX_DELAY_MS = 500;   // longest a change may wait before it is written
+const int FLUSH_MAX_PENDING_OPS = 32; // write immediately once this many changes are queued
 
 vector<Book> books;
 vector<Loan> loans;
@@ -167,6 +182,8 @@ const string BOOKS_FILE = "books.txt";
 const string LOANS_FILE = "loans.txt";
 const string USERS_FILE = "users.txt";
 const string META_FILE = "meta.txt"; // store next IDs here
+const string REPORT_FILE = "report.txt";
+const string ARCHIVE_FILE = "loans_archive.dat"; // returned loans moved out of loans.txt
 
 // ==================== UTIL ====================
 
@@ -250,12 +267,301 @@ void syncAllUserActiveLoans() {
 }
 
 
+// ==================== SEARCH INDEX ====================
+// Typo-tolerant title/author search. A trigram index over the lowercased
+// title and author narrows the catalogue down to candidates, which are then
+// verified with Myers' bit-parallel edit-distance kernel (Hyyro's
+// formulation for finding the pattern anywhere inside the text).
+
+const size_t SEARCH_MAX_PATTERN = 64; // pattern bits must fit in one word
+const int SEARCH_MAX_EDITS = 2;       // typos tolerated, however long the keyword
+const size_t SEARCH_MAX_RESULTS = 20; // closest matches returned
+
+struct SearchHit {
+    int bookIndex = 0;
+    int distance = 0;
+};
+
+struct SearchResult {
+    vector<SearchHit> hits;  // at most SEARCH_MAX_RESULTS, closest first
+    bool truncated = false;  // more books matched than were returned
+};
+
+unordered_map<uint32_t, vector<int>> trigramIndex; // trigram -> book indices (ascending)
+bool searchIndexDirty = true;
+// per-book shared-trigram counters, reused across queries; a counter is
+// only valid while its stamp equals the current query's
+vector<uint16_t> searchShared;
+vector<uint32_t> searchStamp;
+uint32_t searchQuery = 0;
+
+string toLowerCopy(const string& s) {
+    string r = s;
+    for (char& c : r) c = (char)tolower((unsigned char)c);
+    return r;
+}
+
+uint32_t packTrigram(const string& s, size_t i) {
+    return ((uint32_t)(unsigned char)s[i] << 16) |
+        ((uint32_t)(unsigned char)s[i + 1] << 8) |
+        (uint32_t)(unsigned char)s[i + 2];
+}
+
+// Call whenever the books vector changes (add/edit/delete/load).
+void invalidateSearchIndex() {
+    searchIndexDirty = true;
+}
+
+void rebuildSearchIndex() {
+    trigramIndex.clear();
+    vector<uint32_t> grams;
+    for (size_t i = 0; i < books.size(); ++i) {
+        grams.clear();
+        for (const string* field : { &books[i].title, &books[i].author }) {
+            string s = toLowerCopy(*field);
+            for (size_t j = 0; j + 3 <= s.size(); ++j) grams.push_back(packTrigram(s, j));
+        }
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
+        for (uint32_t g : grams) trigramIndex[g].push_back((int)i);
+    }
+    searchShared.assign(books.size(), 0);
+    searchStamp.assign(books.size(), 0);
+    searchQuery = 0;
+    searchIndexDirty = false;
+}
+
+// Lowest number of edits needed to turn `pattern` into some substring of
+// `text`. `peq` holds, per byte value, the bitmask of pattern positions
+// holding that byte (in either case, so the text needs no folding).
+int fuzzySubstringDistance(const uint64_t peq[256], size_t m, const string& text) {
+    const uint64_t last = 1ULL << (m - 1);
+    uint64_t pv = (m == 64) ? ~0ULL : ((1ULL << m) - 1);
+    uint64_t mv = 0;
+    int score = (int)m;
+    int best = score;
+    for (char ch : text) {
+        uint64_t eq = peq[(unsigned char)ch];
+        uint64_t xv = eq | mv;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+        if (ph & last) score++;
+        else if (mh & last) score--;
+        // no carry-in on ph: a match may start at any text position
+        ph <<= 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+        if (score < best) best = score;
+    }
+    return best;
+}
+
+// Exact, case-insensitive substring test; `lower`/`upper` are the pattern
+// in both cases. Cheaper than the edit-distance kernel when no typos are allowed.
+bool containsFolded(const string& text, const string& lower, const string& upper) {
+    const size_t m = lower.size();
+    for (size_t i = 0; i + m <= text.size(); ++i) {
+        size_t j = 0;
+        while (j < m && (text[i + j] == lower[j] || text[i + j] == upper[j])) ++j;
+        if (j == m) return true;
+    }
+    return false;
+}
+
+// Up to SEARCH_MAX_RESULTS books whose title or author contains `keyword`
+// within a small number of edits, best matches first.
+SearchResult fuzzySearchBooks(const string& keyword) {
+    if (searchIndexDirty) rebuildSearchIndex();
+
+    string pattern = toLowerCopy(keyword);
+    if (pattern.size() > SEARCH_MAX_PATTERN) pattern.resize(SEARCH_MAX_PATTERN);
+    const size_t m = pattern.size();
+
+    uint64_t peq[256] = {};
+    for (size_t i = 0; i < m; ++i) {
+        unsigned char c = (unsigned char)pattern[i];
+        peq[c] |= 1ULL << i;
+        peq[(unsigned char)toupper(c)] |= 1ULL << i;
+    }
+
+    vector<uint32_t> grams;
+    for (size_t j = 0; j + 3 <= m; ++j) grams.push_back(packTrigram(pattern, j));
+    sort(grams.begin(), grams.end());
+    grams.erase(unique(grams.begin(), grams.end()), grams.end());
+
+    // q-gram lemma: each edit destroys at most 3 of the pattern's distinct
+    // trigrams, so a match within k edits shares at least |grams| - 3k of
+    // them. Allow about one typo per 4 characters, but only as many as keep
+    // at least half of the trigrams required; otherwise common trigrams
+    // would let most of the catalogue through to verification.
+    int maxEdits = min((int)(m / 4), SEARCH_MAX_EDITS);
+    const int g = (int)grams.size();
+    while (maxEdits > 0 && g - 3 * maxEdits < (g + 1) / 2) maxEdits--;
+
+    string upper = pattern;
+    for (char& c : upper) c = (char)toupper((unsigned char)c);
+    auto distanceTo = [&](const Book& b) {
+        if (maxEdits == 0)
+            return (containsFolded(b.title, pattern, upper) || containsFolded(b.author, pattern, upper)) ? 0 : 1;
+        int d = fuzzySubstringDistance(peq, m, b.title);
+        return d > 0 ? min(d, fuzzySubstringDistance(peq, m, b.author)) : d;
+        };
+
+    SearchResult result;
+    vector<SearchHit>& hits = result.hits;
+    if (g == 0) {
+        // keyword too short for the index: scan the catalogue in order. Only
+        // exact matches count here, so the first SEARCH_MAX_RESULTS are final;
+        // one more match is enough to know the list was cut.
+        for (size_t i = 0; i < books.size(); ++i) {
+            if (distanceTo(books[i]) != 0) continue;
+            if (hits.size() == SEARCH_MAX_RESULTS) { result.truncated = true; break; }
+            hits.push_back({ (int)i, 0 });
+        }
+        return result;
+    }
+
+    vector<int> candidates;
+    {
+        const int minShared = g - 3 * maxEdits;
+        if (++searchQuery == 0) { // stamp wrapped: forget every old counter
+            fill(searchStamp.begin(), searchStamp.end(), 0);
+            searchQuery = 1;
+        }
+        for (uint32_t gram : grams) {
+            auto it = trigramIndex.find(gram);
+            if (it == trigramIndex.end()) continue;
+            for (int idx : it->second) {
+                if (searchStamp[idx] != searchQuery) { searchStamp[idx] = searchQuery; searchShared[idx] = 0; }
+                if (++searchShared[idx] == minShared) candidates.push_back(idx);
+            }
+        }
+    }
+
+    for (int idx : candidates) {
+        int d = distanceTo(books[idx]);
+        if (d <= maxEdits) hits.push_back({ idx, d });
+    }
+    // ties keep catalogue order
+    auto closer = [](const SearchHit& a, const SearchHit& b) {
+        if (a.distance != b.distance) return a.distance < b.distance;
+        return a.bookIndex < b.bookIndex;
+        };
+    if (hits.size() > SEARCH_MAX_RESULTS) {
+        partial_sort(hits.begin(), hits.begin() + SEARCH_MAX_RESULTS, hits.end(), closer);
+        hits.resize(SEARCH_MAX_RESULTS);
+        result.truncated = true;
+    }
+    else {
+        sort(hits.begin(), hits.end(), closer);
+    }
+    return result;
+}
+
+// ==================== SNAPSHOTS ====================
+// Multi-version copies of the Book, Loan and User tables for readers that must
+// not block (or be torn by) live checkouts. The menu thread stays the only
+// writer of `books`/`loans`; after each change it publishes a new version.
+// Versions share unchanged chunks of SNAPSHOT_CHUNK records, so publishing
+// copies only the chunks that were touched. Readers pin a whole library
+// snapshot with one atomic load and keep it alive for as long as they hold
+// the pointer; a version is reclaimed when its last reader lets go.
+
+const size_t SNAPSHOT_CHUNK = 256;
+
+template <typename T>
+class VersionedTable {
+public:
+    struct Version {
+        vector<shared_ptr<const vector<T>>> chunks;
+        size_t size = 0;
+
+        template <typename F>
+        void forEach(F f) const {
+            for (const auto& c : chunks)
+                for (const T& rec : *c) f(rec);
+        }
+    };
+
+    // Writer side: record which rows changed since the last publish.
+    void touch(size_t row) { dirtyChunks.push_back(row / SNAPSHOT_CHUNK); }
+    void touchFrom(size_t row) { dirtyFrom = min(dirtyFrom, row / SNAPSHOT_CHUNK); }
+
+    shared_ptr<const Version> publish(const vector<T>& live) {
+        auto next = make_shared<Version>();
+        size_t nChunks = (live.size() + SNAPSHOT_CHUNK - 1) / SNAPSHOT_CHUNK;
+        vector<bool> dirty(nChunks, false);
+        for (size_t c : dirtyChunks) if (c < nChunks) dirty[c] = true;
+
+        next->size = live.size();
+        next->chunks.reserve(nChunks);
+        for (size_t c = 0; c < nChunks; ++c) {
+            size_t lo = c * SNAPSHOT_CHUNK;
+            size_t hi = min(live.size(), lo + SNAPSHOT_CHUNK);
+            bool reuse = head && c < dirtyFrom && !dirty[c] &&
+                c < head->chunks.size() && head->chunks[c]->size() == hi - lo;
+            if (reuse) next->chunks.push_back(head->chunks[c]);
+            else next->chunks.push_back(make_shared<const vector<T>>(live.begin() + lo, live.begin() + hi));
+        }
+        dirtyChunks.clear();
+        dirtyFrom = SIZE_MAX;
+        head = next;
+        return next;
+    }
+
+private:
+    shared_ptr<const Version> head;
+    vector<size_t> dirtyChunks;
+    size_t dirtyFrom = 0; // everything is dirty before the first publish
+};
+
+struct LibrarySnapshot {
+    uint64_t epoch = 0;
+    shared_ptr<const VersionedTable<Book>::Version> books;
+    shared_ptr<const VersionedTable<Loan>::Version> loans;
+    shared_ptr<const VersionedTable<User>::Version> users;
+    int nextBookID = 1;
+    int nextLoanID = 1;
+};
+
+VersionedTable<Book> bookVersions;
+VersionedTable<Loan> loanVersions;
+VersionedTable<User> userVersions;
+atomic<shared_ptr<const LibrarySnapshot>> currentSnapshot;
+uint64_t snapshotEpoch = 0;
+
+// `b`/`l`/`u` must refer to an element of the global books/loans/users vector.
+void touchBook(const Book& b) { bookVersions.touch(&b - books.data()); }
+void touchLoan(const Loan& l) { loanVersions.touch(&l - loans.data()); }
+void touchUser(const User& u) { userVersions.touch(&u - users.data()); }
+
+// Make all changes since the previous publish visible to readers at once.
+void publishSnapshot() {
+    auto snap = make_shared<LibrarySnapshot>();
+    snap->epoch = ++snapshotEpoch;
+    snap->books = bookVersions.publish(books);
+    snap->loans = loanVersions.publish(loans);
+    snap->users = userVersions.publish(users);
+    snap->nextBookID = nextBookID;
+    snap->nextLoanID = nextLoanID;
+    currentSnapshot.store(snap);
+}
+
+shared_ptr<const LibrarySnapshot> pinSnapshot() {
+    return currentSnapshot.load();
+}
+
 // ==================== FILE IO ====================
 
-void saveMeta() {
+// The save* functions write from a published snapshot so they can run on
+// the flusher thread while the menu keeps changing the live tables.
+
+void saveMeta(const LibrarySnapshot& snap) {
     ofstream of(META_FILE);
     if (!of) return;
-    of << nextBookID << " " << nextLoanID << "\n";
+    of << snap.nextBookID << " " << snap.nextLoanID << "\n";
 }
 void loadMeta() {
     ifstream inf(META_FILE);
@@ -265,10 +571,10 @@ void loadMeta() {
     }
 }
 
-void saveBooks() {
+void saveBooks(const LibrarySnapshot& snap) {
     ofstream of(BOOKS_FILE);
     if (!of) { cerr << "Failed to open " << BOOKS_FILE << " for writing\n"; return; }
-    for (const auto& b : books) of << b.serialize() << "\n";
+    snap.books->forEach([&](const Book& b) { of << b.serialize() << "\n"; });
 }
 
 void loadBooks() {
@@ -281,12 +587,14 @@ void loadBooks() {
         auto ob = Book::deserialize(line);
         if (ob) books.push_back(*ob);
     }
+    bookVersions.touchFrom(0);
+    invalidateSearchIndex();
 }
 
-void saveLoans() {
+void saveLoans(const LibrarySnapshot& snap) {
     ofstream of(LOANS_FILE);
     if (!of) { cerr << "Failed to open " << LOANS_FILE << " for writing\n"; return; }
-    for (const auto& l : loans) of << l.serialize() << "\n";
+    snap.loans->forEach([&](const Loan& l) { of << l.serialize() << "\n"; });
 }
 
 void loadLoans() {
@@ -299,15 +607,16 @@ void loadLoans() {
         auto ol = Loan::deserialize(line);
         if (ol) loans.push_back(*ol);
     }
+    loanVersions.touchFrom(0);
     int maxID = 0;
     for (auto& l : loans) if (l.loanID > maxID) maxID = l.loanID;
     if (nextLoanID <= maxID) nextLoanID = maxID + 1;
 }
 
-void saveUsers() {
+void saveUsers(const LibrarySnapshot& snap) {
     ofstream of(USERS_FILE);
     if (!of) { cerr << "Failed to open " << USERS_FILE << " for writing\n"; return; }
-    for (const auto& u : users) of << u.serialize() << "\n";
+    snap.users->forEach([&](const User& u) { of << u.serialize() << "\n"; });
 }
 
 void loadUsers() {
@@ -320,7 +629,7 @@ void loadUsers() {
         admin.password = "admin123";
         admin.activeLoans = 0;
         users.push_back(admin);
-        saveUsers();
+        userVersions.touchFrom(0);
         return;
     }
     string line;
@@ -335,15 +644,607 @@ void loadUsers() {
         admin.password = "admin123";
         admin.activeLoans = 0;
         users.push_back(admin);
-        saveUsers();
     }
+    userVersions.touchFrom(0);
+}
+
+
+// ==================== PERSISTENCE ====================
+// Changes are committed in memory and written to disk by a background
+// flusher thread. Each commit marks the tables it touched as dirty; the
+// flusher waits up to FLUSH_MAX_DELAY_MS after the first pending change (or
+// until FLUSH_MAX_PENDING_OPS commits pile up) and then rewrites every dirty
+// table once from the latest snapshot, so a burst of changes costs one write
+// per table. flushTablesNow() skips the queue for writes that must be on disk
+// before the caller continues (the archive sweep).
+
+enum DirtyTable {
+    DIRTY_BOOKS = 1,
+    DIRTY_LOANS = 2,
+    DIRTY_USERS = 4,
+    DIRTY_META = 8,
+};
+
+struct FlushStats {
+    uint64_t commits = 0;      // commitChanges() and flushTablesNow() calls
+    uint64_t tableMarks = 0;   // tables changed across all commits
+    uint64_t tableWrites = 0;  // table files actually written
+    uint64_t flushes = 0;
+    double totalMs = 0.0;
+    double maxMs = 0.0;
+};
+
+mutex flushMutex;
+condition_variable flushCv;
+unsigned dirtyTables = 0;
+int pendingOps = 0;
+chrono::steady_clock::time_point firstPendingAt;
+bool flusherStopping = false;
+FlushStats flushStats;
+thread flusher;
+mutex fileWriteMutex; // one table writer at a time, so the newest snapshot lands last
+
+void markDirty(unsigned tables) {
+    {
+        lock_guard<mutex> lk(flushMutex);
+        if (dirtyTables == 0) firstPendingAt = chrono::steady_clock::now();
+        dirtyTables |= tables;
+        pendingOps++;
+        flushStats.commits++;
+        for (unsigned t = tables; t; t &= t - 1) flushStats.tableMarks++;
+    }
+    flushCv.notify_one();
+}
+
+// Publish the touched rows to readers and queue the tables for writing.
+void commitChanges(unsigned tables) {
+    publishSnapshot();
+    markDirty(tables);
+}
+
+// Write `tables` from the latest snapshot and record the flush.
+void writeTables(unsigned tables) {
+    auto start = chrono::steady_clock::now();
+    {
+        lock_guard<mutex> wl(fileWriteMutex);
+        auto snap = pinSnapshot();
+        if (tables & DIRTY_BOOKS) saveBooks(*snap);
+        if (tables & DIRTY_LOANS) saveLoans(*snap);
+        if (tables & DIRTY_USERS) saveUsers(*snap);
+        if (tables & DIRTY_META) saveMeta(*snap);
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    lock_guard<mutex> lk(flushMutex);
+    flushStats.flushes++;
+    for (unsigned t = tables; t; t &= t - 1) flushStats.tableWrites++;
+    flushStats.totalMs += ms;
+    flushStats.maxMs = max(flushStats.maxMs, ms);
+}
+
+// Publish and write `tables` on the calling thread, for callers whose next
+// step relies on the files already being on disk.
+void flushTablesNow(unsigned tables) {
+    publishSnapshot();
+    {
+        // this write covers every change so far; the flusher need not repeat it
+        lock_guard<mutex> lk(flushMutex);
+        dirtyTables &= ~tables;
+        if (dirtyTables == 0) pendingOps = 0;
+        flushStats.commits++;
+        for (unsigned t = tables; t; t &= t - 1) flushStats.tableMarks++;
+    }
+    writeTables(tables);
+}
+
+void flusherLoop() {
+    unique_lock<mutex> lk(flushMutex);
+    while (true) {
+        flushCv.wait(lk, [] { return flusherStopping || dirtyTables != 0; });
+        if (!flusherStopping) {
+            flushCv.wait_until(lk, firstPendingAt + chrono::milliseconds(FLUSH_MAX_DELAY_MS),
+                [] { return flusherStopping || pendingOps >= FLUSH_MAX_PENDING_OPS; });
+        }
+        unsigned tables = dirtyTables;
+        dirtyTables = 0;
+        pendingOps = 0;
+        if (tables == 0) {
+            if (flusherStopping) break; // nothing left to write
+            continue;                   // flushTablesNow() already wrote it
+        }
+        lk.unlock();
+        writeTables(tables);
+        lk.lock();
+    }
+}
+
+void startPersistence() {
+    flusher = thread(flusherLoop);
+}
+
+// Barrier: returns once every committed change is on disk.
+void shutdownPersistence() {
+    {
+        lock_guard<mutex> lk(flushMutex);
+        flusherStopping = true;
+    }
+    flushCv.notify_one();
+    if (flusher.joinable()) flusher.join();
+}
+
+// ==================== LOAN ARCHIVE ====================
+// Returned, settled loans older than ARCHIVE_AFTER_DAYS are moved out of
+// `loans` into an append-only binary archive. Each sweep sorts the loans it
+// moves by username and loan date and writes one block per user:
+//
+//   magic | user | count | firstDate | lastDate | maxLoanID | payloadSize | payload
+//
+// All header numbers are varints. The payload stores each loan as zigzag
+// varint deltas against the previous loan in the block, and due/return
+// dates relative to the loan date, so most fields take one or two bytes.
+// Only the headers are read at startup (into archiveIndex); a user's history
+// is decoded from their blocks on demand.
+//
+// Loans are in date order within a block, but a user's blocks are in sweep
+// order: a loan whose fee was paid late is archived by a later sweep than
+// newer loans. Date-bounded queries therefore check every block's
+// [firstDate, lastDate] range instead of stopping at the first one past it.
+
+const unsigned char ARCHIVE_BLOCK_MAGIC = 0xB7;
+const size_t ARCHIVE_BLOCK_RECORDS = 512; // max loans per block
+
+struct ArchiveBlock {
+    time_t firstDate = 0;
+    time_t lastDate = 0;
+    streamoff payloadOffset = 0;
+    uint64_t payloadSize = 0;
+    uint64_t count = 0;
+};
+
+using ArchiveIndex = unordered_map<string, vector<ArchiveBlock>>; // username -> blocks, in sweep order
+
+// replaced wholesale by loadArchiveIndex(), never modified in place, so a
+// background reader can hold on to the version it started with
+shared_ptr<const ArchiveIndex> archiveIndex = make_shared<ArchiveIndex>();
+streamoff archiveEnd = 0; // end of the last intact block
+size_t archivedLoanCount = 0;
+
+void putVarint(string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+bool getVarint(const string& in, size_t& pos, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+        unsigned char c = (unsigned char)in[pos++];
+        v |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+bool readVarint(istream& in, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = in.get();
+        if (c == EOF) return false;
+        v |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+uint64_t zigzag(long long v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+long long unzigzag(uint64_t v) { return (long long)(v >> 1) ^ -(long long)(v & 1); }
+
+void loadArchiveIndex() {
+    auto index = make_shared<ArchiveIndex>();
+    archiveIndex = index;
+    archiveEnd = 0;
+    archivedLoanCount = 0;
+    ifstream inf(ARCHIVE_FILE, ios::binary | ios::ate);
+    if (!inf) return;
+    const streamoff fileSize = inf.tellg();
+    inf.seekg(0);
+    int maxID = 0;
+    // stop at the first block that is not intact: a sweep was interrupted mid-write
+    while (inf.get() == ARCHIVE_BLOCK_MAGIC) {
+        uint64_t userLen, count, firstDate, lastDate, maxLoanID, payloadSize;
+        if (!readVarint(inf, userLen) || userLen > 4096) break;
+        string user(userLen, '\0');
+        if (!inf.read(&user[0], userLen)) break;
+        if (!readVarint(inf, count) || !readVarint(inf, firstDate) || !readVarint(inf, lastDate) ||
+            !readVarint(inf, maxLoanID) || !readVarint(inf, payloadSize)) break;
+        ArchiveBlock blk;
+        blk.firstDate = (time_t)firstDate;
+        blk.lastDate = (time_t)lastDate;
+        blk.payloadOffset = inf.tellg();
+        blk.payloadSize = payloadSize;
+        blk.count = count;
+        if (blk.payloadOffset + (streamoff)payloadSize > fileSize) break;
+
+        (*index)[user].push_back(blk);
+        archiveEnd = blk.payloadOffset + (streamoff)payloadSize;
+        archivedLoanCount += count;
+        if ((int)maxLoanID > maxID) maxID = (int)maxLoanID;
+        inf.seekg(archiveEnd);
+    }
+    if (nextLoanID <= maxID) nextLoanID = maxID + 1;
+}
+
+vector<Loan> decodeArchiveBlock(istream& in, const string& username, const ArchiveBlock& blk) {
+    vector<Loan> out;
+    string payload(blk.payloadSize, '\0');
+    in.clear();
+    in.seekg(blk.payloadOffset);
+    if (!in.read(&payload[0], payload.size())) return out;
+    size_t pos = 0;
+    long long loanID = 0, bookID = 0, loanDate = 0;
+    for (uint64_t i = 0; i < blk.count; ++i) {
+        uint64_t f[6];
+        for (uint64_t& x : f)
+            if (!getVarint(payload, pos, x)) return out;
+        Loan L;
+        loanID += unzigzag(f[0]);
+        bookID += unzigzag(f[1]);
+        loanDate += unzigzag(f[2]);
+        L.loanID = (int)loanID;
+        L.bookID = (int)bookID;
+        L.username = username;
+        L.loanDate = (time_t)loanDate;
+        L.dueDate = (time_t)(loanDate + unzigzag(f[3]));
+        L.returnDate = (time_t)(L.dueDate + unzigzag(f[4]));
+        L.isReturned = true;
+        L.overdueAmount = unzigzag(f[5]) / 100.0;
+        out.push_back(L);
+    }
+    return out;
+}
+
+// Archived loans of one patron made between `from` and `to` (inclusive),
+// oldest first. Only blocks whose date range overlaps are decoded.
+vector<Loan> archivedLoansFor(const string& username, time_t from = 0,
+    time_t to = numeric_limits<time_t>::max()) {
+    vector<Loan> out;
+    auto it = archiveIndex->find(username);
+    if (it == archiveIndex->end()) return out;
+    ifstream inf(ARCHIVE_FILE, ios::binary);
+    if (!inf) return out;
+    for (const auto& blk : it->second) {
+        if (blk.lastDate < from || blk.firstDate > to) continue;
+        for (const auto& l : decodeArchiveBlock(inf, username, blk))
+            if (l.loanDate >= from && l.loanDate <= to) out.push_back(l);
+    }
+    stable_sort(out.begin(), out.end(), [](const Loan& a, const Loan& b) { return a.loanDate < b.loanDate; });
+    return out;
+}
+
+string encodeArchiveBlock(const string& username, vector<Loan>::const_iterator first,
+    vector<Loan>::const_iterator last) {
+    string payload;
+    long long loanID = 0, bookID = 0, loanDate = 0;
+    int maxLoanID = 0;
+    for (auto it = first; it != last; ++it) {
+        putVarint(payload, zigzag(it->loanID - loanID));
+        putVarint(payload, zigzag(it->bookID - bookID));
+        putVarint(payload, zigzag((long long)it->loanDate - loanDate));
+        putVarint(payload, zigzag((long long)(it->dueDate - it->loanDate)));
+        putVarint(payload, zigzag((long long)(it->returnDate - it->dueDate)));
+        putVarint(payload, zigzag(llround(it->overdueAmount * 100)));
+        loanID = it->loanID;
+        bookID = it->bookID;
+        loanDate = (long long)it->loanDate;
+        maxLoanID = max(maxLoanID, it->loanID);
+    }
+    string blk(1, (char)ARCHIVE_BLOCK_MAGIC);
+    putVarint(blk, username.size());
+    blk += username;
+    putVarint(blk, (uint64_t)(last - first));
+    putVarint(blk, (uint64_t)first->loanDate);
+    putVarint(blk, (uint64_t)(last - 1)->loanDate);
+    putVarint(blk, (uint64_t)maxLoanID);
+    putVarint(blk, payload.size());
+    return blk + payload;
+}
+
+// Move old, settled loans from the hot table to the archive. The archive is
+// written (and flushed) before loans.txt is rewritten without them. If a
+// crash lands in between, the next sweep finds those loans still hot; any
+// whose loanID is already in the user's archived history is just dropped
+// from the hot table instead of being appended a second time.
+void archiveOldLoans() {
+    time_t cutoff = time(nullptr) - (time_t)ARCHIVE_AFTER_DAYS * 24 * 60 * 60;
+    auto settled = [cutoff](const Loan& l) {
+        return l.isReturned && l.overdueAmount <= 0 && l.returnDate < cutoff;
+        };
+    vector<Loan> moving;
+    for (const auto& l : loans) if (settled(l)) moving.push_back(l);
+    if (moving.empty()) return;
+    sort(moving.begin(), moving.end(), [](const Loan& a, const Loan& b) {
+        if (a.username != b.username) return a.username < b.username;
+        if (a.loanDate != b.loanDate) return a.loanDate < b.loanDate;
+        return a.loanID < b.loanID;
+        });
+
+    // skip loans an interrupted earlier sweep already archived; only the
+    // blocks of users in this sweep are decoded
+    vector<Loan> fresh;
+    for (size_t i = 0; i < moving.size();) {
+        size_t j = i;
+        while (j < moving.size() && moving[j].username == moving[i].username) ++j;
+        // moving[i..j) is sorted by date, so this bounds the blocks to decode
+        vector<int> archivedIDs;
+        for (const auto& l : archivedLoansFor(moving[i].username, moving[i].loanDate, moving[j - 1].loanDate))
+            archivedIDs.push_back(l.loanID);
+        sort(archivedIDs.begin(), archivedIDs.end());
+        for (size_t k = i; k < j; ++k)
+            if (!binary_search(archivedIDs.begin(), archivedIDs.end(), moving[k].loanID))
+                fresh.push_back(moving[k]);
+        i = j;
+    }
+
+    if (!fresh.empty()) {
+        // drop any torn tail left by an interrupted sweep before appending
+        error_code ec;
+        if (filesystem::exists(ARCHIVE_FILE, ec) && (streamoff)filesystem::file_size(ARCHIVE_FILE, ec) > archiveEnd)
+            filesystem::resize_file(ARCHIVE_FILE, (uintmax_t)archiveEnd, ec);
+
+        ofstream of(ARCHIVE_FILE, ios::binary | ios::app);
+        if (!of) { cerr << "Failed to open " << ARCHIVE_FILE << " for writing\n"; return; }
+        for (size_t i = 0; i < fresh.size();) {
+            size_t j = i;
+            while (j < fresh.size() && j - i < ARCHIVE_BLOCK_RECORDS && fresh[j].username == fresh[i].username) ++j;
+            string blk = encodeArchiveBlock(fresh[i].username, fresh.begin() + i, fresh.begin() + j);
+            of.write(blk.data(), blk.size());
+            i = j;
+        }
+        of.flush();
+        if (!of) { cerr << "Failed to write " << ARCHIVE_FILE << "\n"; return; }
+        of.close();
+    }
+
+    loans.erase(remove_if(loans.begin(), loans.end(), settled), loans.end());
+    loanVersions.touchFrom(0);
+    flushTablesNow(DIRTY_LOANS); // not deferred: keeps the crash window to this one write
+    loadArchiveIndex();
+}
+
+// ==================== RECOMMENDATIONS ====================
+// "Patrons also borrowed": for every book, the books most often borrowed by
+// the same patrons. Built from the loan history as a sparse book x book
+// co-occurrence matrix in CSR form, keeping only the strongest entries per
+// row. New loans are folded into a small delta until it is worth rebuilding;
+// rebuilds run on a background thread and are swapped in by the menu thread
+// (a full build over 10M loans takes tens of seconds on a single core).
+//
+// Counts are lower bounds: a pair that was not among a row's RECOMMEND_KEEP
+// strongest at build time shows only the loans made since, until the next
+// rebuild picks up its full count.
+
+const int RECOMMEND_KEEP = 50;               // related books stored per row
+const int RECOMMEND_SHOW = 5;                // related books shown to patrons
+const size_t RECOMMEND_DELTA_LIMIT = 4096;   // pending pair updates before a rebuild
+const int RECOMMEND_ROW_BLOCK = 256;         // rows handed to a worker at a time
+
+struct CoBorrowIndex {
+    vector<int> bookIDs;        // row -> bookID, ascending
+    vector<size_t> rowStart;    // row r spans [rowStart[r], rowStart[r + 1])
+    vector<int> related;        // related bookID
+    vector<uint32_t> counts;    // patrons who borrowed both books
+};
+
+// menu thread only
+CoBorrowIndex coBorrow;
+unordered_map<int, unordered_map<int, uint32_t>> coBorrowDelta;        // bookID -> related bookID -> count
+unordered_map<int, unordered_map<int, uint32_t>> coBorrowDeltaInBuild; // delta the running build already covers
+size_t coBorrowDeltaPairs = 0;
+
+// background rebuild: the worker fills coBorrowNext, then sets coBorrowBuilt
+thread coBorrowWorker;
+CoBorrowIndex coBorrowNext;
+atomic<bool> coBorrowBuilt(false);
+atomic<bool> coBorrowCancel(false);
+
+CoBorrowIndex buildCoBorrowIndex(const vector<Loan>& history, const atomic<bool>& cancel) {
+    CoBorrowIndex idx;
+
+    // dense ids for patrons and books
+    unordered_map<string, int> userOf;
+    unordered_map<int, int> rowOf;
+    vector<pair<int, int>> pairs; // (user, row)
+    pairs.reserve(history.size());
+    for (const auto& l : history) {
+        int u = userOf.emplace(l.username, (int)userOf.size()).first->second;
+        rowOf.emplace(l.bookID, 0);
+        pairs.push_back({ u, l.bookID });
+    }
+    idx.bookIDs.reserve(rowOf.size());
+    for (const auto& kv : rowOf) idx.bookIDs.push_back(kv.first);
+    sort(idx.bookIDs.begin(), idx.bookIDs.end());
+    for (size_t r = 0; r < idx.bookIDs.size(); ++r) rowOf[idx.bookIDs[r]] = (int)r;
+    for (auto& p : pairs) p.second = rowOf[p.second];
+
+    // distinct books per patron, then patrons per book (both CSR)
+    sort(pairs.begin(), pairs.end());
+    pairs.erase(unique(pairs.begin(), pairs.end()), pairs.end());
+    const int nUsers = (int)userOf.size();
+    const int nRows = (int)idx.bookIDs.size();
+    vector<size_t> basketStart(nUsers + 1, 0), readerStart(nRows + 1, 0);
+    vector<int> basket(pairs.size()), readers(pairs.size());
+    for (const auto& p : pairs) { basketStart[p.first + 1]++; readerStart[p.second + 1]++; }
+    for (int u = 0; u < nUsers; ++u) basketStart[u + 1] += basketStart[u];
+    for (int r = 0; r < nRows; ++r) readerStart[r + 1] += readerStart[r];
+    {
+        vector<size_t> fill(readerStart.begin(), readerStart.end() - 1);
+        for (size_t i = 0; i < pairs.size(); ++i) {
+            basket[i] = pairs[i].second; // pairs are sorted by user already
+            readers[fill[pairs[i].second]++] = pairs[i].first;
+        }
+    }
+    vector<pair<int, int>>().swap(pairs);
+
+    // row r of the co-occurrence matrix = sum of the baskets of r's readers.
+    // Workers take blocks of consecutive rows and accumulate each row into a
+    // private dense array, so the only shared writes are to their own rows.
+    vector<vector<pair<uint32_t, int>>> rows(nRows); // (count, related row)
+    atomic<int> nextBlock(0);
+    auto worker = [&]() {
+        vector<uint32_t> acc(nRows, 0);
+        vector<int> touched;
+        while (!cancel) {
+            int lo = nextBlock.fetch_add(RECOMMEND_ROW_BLOCK);
+            if (lo >= nRows) break;
+            int hi = min(nRows, lo + RECOMMEND_ROW_BLOCK);
+            for (int r = lo; r < hi; ++r) {
+                for (size_t i = readerStart[r]; i < readerStart[r + 1]; ++i) {
+                    int u = readers[i];
+                    for (size_t j = basketStart[u]; j < basketStart[u + 1]; ++j) {
+                        int c = basket[j];
+                        if (c != r && acc[c]++ == 0) touched.push_back(c);
+                    }
+                }
+                auto& out = rows[r];
+                out.reserve(touched.size());
+                for (int c : touched) { out.push_back({ acc[c], c }); acc[c] = 0; }
+                touched.clear();
+                auto stronger = [](const pair<uint32_t, int>& a, const pair<uint32_t, int>& b) {
+                    return a.first != b.first ? a.first > b.first : a.second < b.second;
+                    };
+                if ((int)out.size() > RECOMMEND_KEEP) {
+                    partial_sort(out.begin(), out.begin() + RECOMMEND_KEEP, out.end(), stronger);
+                    out.resize(RECOMMEND_KEEP);
+                    out.shrink_to_fit();
+                }
+                else {
+                    sort(out.begin(), out.end(), stronger);
+                }
+            }
+        }
+        };
+    int nThreads = (int)max(1u, thread::hardware_concurrency());
+    nThreads = min(nThreads, max(1, nRows / RECOMMEND_ROW_BLOCK));
+    vector<thread> pool;
+    for (int t = 1; t < nThreads; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+
+    idx.rowStart.assign(nRows + 1, 0);
+    for (int r = 0; r < nRows; ++r) idx.rowStart[r + 1] = idx.rowStart[r] + rows[r].size();
+    idx.related.resize(idx.rowStart[nRows]);
+    idx.counts.resize(idx.rowStart[nRows]);
+    for (int r = 0; r < nRows; ++r) {
+        size_t k = idx.rowStart[r];
+        for (const auto& e : rows[r]) {
+            idx.related[k] = idx.bookIDs[e.second];
+            idx.counts[k] = e.first;
+            ++k;
+        }
+    }
+    return idx;
+}
+
+// Runs on coBorrowWorker. Reads only the pinned snapshot, the archive index
+// version it was started with and the append-only archive file.
+void coBorrowBuildLoop(shared_ptr<const LibrarySnapshot> snap,
+    shared_ptr<const ArchiveIndex> archived, size_t archivedCount) {
+    {
+        vector<Loan> history;
+        history.reserve(archivedCount + snap->loans->size);
+        ifstream inf(ARCHIVE_FILE, ios::binary);
+        for (const auto& kv : *archived) {
+            if (coBorrowCancel) return;
+            for (const auto& blk : kv.second) {
+                auto part = decodeArchiveBlock(inf, kv.first, blk);
+                history.insert(history.end(), part.begin(), part.end());
+            }
+        }
+        snap->loans->forEach([&](const Loan& l) { history.push_back(l); });
+        coBorrowNext = buildCoBorrowIndex(history, coBorrowCancel);
+    } // free the history before signalling, so the swap's join is immediate
+    snap.reset();
+    archived.reset();
+    if (!coBorrowCancel) coBorrowBuilt.store(true);
+}
+
+// Swap in a finished background build, if there is one.
+void adoptCoBorrowBuild() {
+    if (!coBorrowBuilt.load()) return;
+    if (coBorrowWorker.joinable()) coBorrowWorker.join();
+    coBorrow = move(coBorrowNext);
+    coBorrowNext = CoBorrowIndex();
+    coBorrowDeltaInBuild.clear();
+    coBorrowBuilt.store(false);
+}
+
+// Start rebuilding from the current snapshot unless a build is running.
+// Loans recorded from here on go to a fresh delta; the old one stays
+// visible until the new index replaces it.
+void startCoBorrowRebuild() {
+    adoptCoBorrowBuild();
+    if (coBorrowWorker.joinable()) return;
+    for (auto& row : coBorrowDelta)
+        for (const auto& kv : row.second) coBorrowDeltaInBuild[row.first][kv.first] += kv.second;
+    coBorrowDelta.clear();
+    coBorrowDeltaPairs = 0;
+    coBorrowWorker = thread(coBorrowBuildLoop, pinSnapshot(), archiveIndex, archivedLoanCount);
+}
+
+void stopCoBorrowRebuild() {
+    coBorrowCancel = true;
+    if (coBorrowWorker.joinable()) coBorrowWorker.join();
+    coBorrowBuilt = false;
+    coBorrowCancel = false;
+}
+
+// Fold a newly created loan (already in `loans`) into the recommendations.
+void recordCoBorrow(const Loan& newLoan) {
+    adoptCoBorrowBuild();
+    vector<int> others;
+    for (const auto& l : loans) {
+        if (l.username != newLoan.username || l.loanID == newLoan.loanID) continue;
+        if (l.bookID == newLoan.bookID) return; // re-borrowing adds no new pairs
+        others.push_back(l.bookID);
+    }
+    for (const auto& l : archivedLoansFor(newLoan.username)) {
+        if (l.bookID == newLoan.bookID) return;
+        others.push_back(l.bookID);
+    }
+    sort(others.begin(), others.end());
+    others.erase(unique(others.begin(), others.end()), others.end());
+    for (int other : others) {
+        coBorrowDelta[newLoan.bookID][other]++;
+        coBorrowDelta[other][newLoan.bookID]++;
+    }
+    coBorrowDeltaPairs += 2 * others.size();
+    if (coBorrowDeltaPairs > RECOMMEND_DELTA_LIMIT) startCoBorrowRebuild();
 }
 
-void persistAll() {
-    saveBooks();
-    saveLoans();
-    saveUsers();
-    saveMeta();
+// All known (bookID, shared patrons) for `bookID`, strongest first. May
+// include books that have since been deleted from the catalogue.
+vector<pair<int, uint32_t>> relatedBooks(int bookID) {
+    adoptCoBorrowBuild();
+    unordered_map<int, uint32_t> merged;
+    auto row = lower_bound(coBorrow.bookIDs.begin(), coBorrow.bookIDs.end(), bookID);
+    if (row != coBorrow.bookIDs.end() && *row == bookID) {
+        size_t r = row - coBorrow.bookIDs.begin();
+        for (size_t k = coBorrow.rowStart[r]; k < coBorrow.rowStart[r + 1]; ++k)
+            merged[coBorrow.related[k]] += coBorrow.counts[k];
+    }
+    for (const auto* delta : { &coBorrowDeltaInBuild, &coBorrowDelta }) {
+        auto d = delta->find(bookID);
+        if (d != delta->end())
+            for (const auto& kv : d->second) merged[kv.first] += kv.second;
+    }
+
+    vector<pair<int, uint32_t>> out(merged.begin(), merged.end());
+    sort(out.begin(), out.end(), [](const pair<int, uint32_t>& a, const pair<int, uint32_t>& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+    return out;
 }
 
 // ==================== AUTH ====================
@@ -374,7 +1275,8 @@ bool loginUser() {
             for (auto& usr : users) {
                 usr.activeLoans = getUserActiveLoansCount(usr.username);
             }
-            saveUsers();
+            userVersions.touchFrom(0);
+            commitChanges(DIRTY_USERS);
 
             currentUser = username;
 
@@ -405,7 +1307,8 @@ void registerUser() {
     string password = inputLine("Enter password: ");
 
     users.push_back({ username, password, 0 });
-    saveUsers();
+    touchUser(users.back());
+    commitChanges(DIRTY_USERS);
 
     cout << "\nRegistration successful! You can now login.\n";
     pressEnterToContinue();
@@ -429,8 +1332,9 @@ void addBook() {
     b.isAvailable = true;
 
     books.push_back(b);
-    saveBooks();
-    saveMeta();
+    touchBook(books.back());
+    commitChanges(DIRTY_BOOKS | DIRTY_META);
+    invalidateSearchIndex();
 
     cout << "\nBook added successfully!\n";
     pressEnterToContinue();
@@ -470,20 +1374,20 @@ static void searchBook() {
     cout << "=================== SEARCH BOOK ====================\n";
 
     string keyword = inputLine("Enter title or author: ");
-    bool found = false;
-
-    for (const Book& b : books) {
-        if (b.title.find(keyword) != string::npos ||
-            b.author.find(keyword) != string::npos) {
 
-            cout << "\nID: " << b.bookID;
-            cout << "\nTitle: " << b.title;
-            cout << "\nAuthor: " << b.author;
-            cout << "\nStatus: " << (b.isAvailable ? "Available" : "Loaned") << "\n";
-            found = true;
-        }
+    SearchResult result = fuzzySearchBooks(keyword);
+    for (const SearchHit& h : result.hits) {
+        const Book& b = books[h.bookIndex];
+        cout << "\nID: " << b.bookID;
+        cout << "\nTitle: " << b.title;
+        cout << "\nAuthor: " << b.author;
+        cout << "\nStatus: " << (b.isAvailable ? "Available" : "Loaned") << "\n";
+        if (h.distance > 0)
+            cout << "(close match, " << h.distance << (h.distance == 1 ? " typo)\n" : " typos)\n");
     }
-    if (!found) cout << "\nNo book found.\n";
+    if (result.hits.empty()) cout << "\nNo book found.\n";
+    else if (result.truncated)
+        cout << "\nShowing the " << SEARCH_MAX_RESULTS << " closest matches. Refine the keyword to narrow the list.\n";
     pressEnterToContinue();
 }
 
@@ -506,7 +1410,9 @@ void editBook() {
             getline(cin, s);
             if (!s.empty()) b.isbn = s;
 
-            saveBooks();
+            touchBook(b);
+            commitChanges(DIRTY_BOOKS);
+            invalidateSearchIndex();
             cout << "Book updated.\n";
             pressEnterToContinue();
             return;
@@ -529,11 +1435,42 @@ void deleteBook() {
         pressEnterToContinue(); return;
     }
     books.erase(books.begin() + idx);
-    saveBooks();
+    bookVersions.touchFrom(idx);
+    commitChanges(DIRTY_BOOKS);
+    invalidateSearchIndex();
     cout << "Book deleted successfully!\n";
     pressEnterToContinue();
 }
 
+void viewRelatedBooks() {
+    clearScreen();
+    cout << "============= PATRONS ALSO BORROWED =============\n";
+    int id = inputInt("Enter Book ID: ");
+
+    auto related = relatedBooks(id);
+    // one pass over the catalogue to find which related books still exist
+    unordered_map<int, const Book*> inCatalogue;
+    for (const auto& r : related) inCatalogue[r.first] = nullptr;
+    for (const Book& b : books) {
+        auto it = inCatalogue.find(b.bookID);
+        if (it != inCatalogue.end()) it->second = &b;
+    }
+
+    int shown = 0;
+    for (const auto& r : related) {
+        const Book* b = inCatalogue[r.first];
+        if (!b) continue; // deleted since it was borrowed
+        cout << "\nID: " << b->bookID;
+        cout << "\nTitle: " << b->title;
+        cout << "\nAuthor: " << b->author;
+        cout << "\nBorrowed together by " << r.second
+            << (r.second == 1 ? " patron\n" : " patrons\n");
+        if (++shown == RECOMMEND_SHOW) break;
+    }
+    if (shown == 0) cout << "\nNo related books yet.\n";
+    pressEnterToContinue();
+}
+
 // ==================== BOOK LOAN ====================
 
 void loanBook() {
@@ -562,10 +1499,10 @@ void loanBook() {
 
             loans.push_back(l);
             b.isAvailable = false;
-
-            saveLoans();
-            saveBooks();
-            saveMeta();
+            touchLoan(loans.back());
+            touchBook(b);
+            commitChanges(DIRTY_LOANS | DIRTY_BOOKS | DIRTY_META);
+            recordCoBorrow(l);
 
             cout << "Book loaned successfully.\n";
             pressEnterToContinue();
@@ -592,7 +1529,7 @@ void returnBook() {
             auto it = findUserIndex(currentUser);
             if (it) {
                 users[*it].activeLoans = getUserActiveLoansCount(currentUser);
-                saveUsers();
+                touchUser(users[*it]);
             }
             l.returnDate = time(nullptr);
 
@@ -602,11 +1539,12 @@ void returnBook() {
                 cout << "Late return. Fee: RM " << l.overdueAmount << "\n";
             }
             for (Book& b : books)
-                if (b.bookID == l.bookID)
+                if (b.bookID == l.bookID) {
                     b.isAvailable = true;
-
-            saveLoans();
-            saveBooks();
+                    touchBook(b);
+                }
+            touchLoan(l);
+            commitChanges(DIRTY_LOANS | DIRTY_BOOKS | DIRTY_USERS);
 
             cout << "Book returned.\n";
             pressEnterToContinue();
@@ -645,7 +1583,8 @@ void payOverdue() {
         if (l.loanID == id && l.username == currentUser && l.overdueAmount > 0) {
             cout << "Paid RM " << l.overdueAmount << "\n";
             l.overdueAmount = 0;
-            saveLoans();
+            touchLoan(l);
+            commitChanges(DIRTY_LOANS);
             pressEnterToContinue();
             return;
         }
@@ -654,6 +1593,96 @@ void payOverdue() {
     pressEnterToContinue();
 }
 
+// ==================== LOAN HISTORY ====================
+
+void viewLoanHistory() {
+    clearScreen();
+    cout << "==================== LOAN HISTORY ====================\n";
+
+    int days = inputInt("Show loans from the last how many days? (0 for all): ", 0, 36500);
+    time_t from = days == 0 ? 0 : time(nullptr) - (time_t)days * 24 * 60 * 60;
+
+    vector<Loan> history = archivedLoansFor(currentUser, from);
+    for (const Loan& l : loans)
+        if (l.username == currentUser && l.loanDate >= from) history.push_back(l);
+    sort(history.begin(), history.end(), [](const Loan& a, const Loan& b) {
+        return a.loanDate != b.loanDate ? a.loanDate < b.loanDate : a.loanID < b.loanID;
+        });
+    history.erase(unique(history.begin(), history.end(), [](const Loan& a, const Loan& b) {
+        return a.loanID == b.loanID;
+        }), history.end());
+
+    auto day = [](time_t t) {
+        char buf[16];
+        strftime(buf, sizeof(buf), "%Y-%m-%d", localtime(&t));
+        return string(buf);
+        };
+    for (const Loan& l : history) {
+        string title = "(deleted book)";
+        for (const Book& b : books)
+            if (b.bookID == l.bookID) { title = b.title; break; }
+        cout << "Loan ID: " << l.loanID << " | " << title
+            << " | Loaned: " << day(l.loanDate)
+            << " | " << (l.isReturned ? "Returned: " + day(l.returnDate) : "Due: " + day(l.dueDate)) << "\n";
+    }
+    if (history.empty()) cout << (days == 0 ? "No loans yet.\n" : "No loans in that period.\n");
+    pressEnterToContinue();
+}
+
+// ==================== REPORTS ====================
+
+thread reportWorker;
+
+// Runs on its own thread against a pinned snapshot, so checkouts and returns
+// carry on while the report is written.
+void writeLibraryReport(shared_ptr<const LibrarySnapshot> snap, time_t now, string generatedAt) {
+    ofstream of(REPORT_FILE);
+    if (!of) return;
+
+    int available = 0;
+    snap->books->forEach([&](const Book& b) { if (b.isAvailable) available++; });
+    of << "BKCL LIBRARY REPORT\n";
+    of << "Generated: " << generatedAt << " (snapshot " << snap->epoch << ")\n\n";
+    of << "Books: " << snap->books->size << " (" << available << " available, "
+        << snap->books->size - available << " loaned)\n";
+    snap->books->forEach([&](const Book& b) {
+        of << b.bookID << " | " << b.title << " | " << b.author << " | " << b.isbn
+            << " | " << (b.isAvailable ? "Available" : "Loaned") << "\n";
+        });
+
+    int openLoans = 0, overdue = 0;
+    map<string, double> fees;
+    snap->loans->forEach([&](const Loan& l) {
+        if (!l.isReturned) {
+            openLoans++;
+            if (l.dueDate < now) overdue++;
+        }
+        if (l.overdueAmount > 0) fees[l.username] += l.overdueAmount;
+        });
+    of << "\nLoans: " << snap->loans->size << " (" << openLoans << " open, " << overdue << " overdue)\n";
+    of << "\nOutstanding fees:\n";
+    double total = 0.0;
+    for (const auto& kv : fees) {
+        of << kv.first << " | RM " << fixed << setprecision(2) << kv.second << "\n";
+        total += kv.second;
+    }
+    of << "Total | RM " << fixed << setprecision(2) << total << "\n";
+}
+
+void exportLibraryReport() {
+    clearScreen();
+    cout << "================= EXPORT REPORT =================\n";
+
+    if (reportWorker.joinable()) reportWorker.join();
+    time_t now = time(nullptr);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M", localtime(&now));
+    reportWorker = thread(writeLibraryReport, pinSnapshot(), now, string(stamp));
+
+    cout << "Report is being written to " << REPORT_FILE << " in the background.\n";
+    pressEnterToContinue();
+}
+
 // ==================== MENUS ====================
 
 void bookCatalogueMenu() {
@@ -669,9 +1698,10 @@ void bookCatalogueMenu() {
         cout << "3. Search Book\n";
         cout << "4. Edit Book Information\n";
         cout << "5. Delete Book\n";
+        cout << "6. Patrons Also Borrowed\n";
         cout << "0. Back to Main Menu\n";
 
-        choice = inputInt("Enter your choice: ", 0, 5);
+        choice = inputInt("Enter your choice: ", 0, 6);
 
         switch (choice) {
         case 1: addBook(); break;
@@ -679,6 +1709,7 @@ void bookCatalogueMenu() {
         case 3: searchBook(); break;
         case 4: editBook(); break;
         case 5: deleteBook(); break;
+        case 6: viewRelatedBooks(); break;
         }
     } while (choice != 0);
 }
@@ -699,9 +1730,11 @@ void mainMenu() {
         cout << "3. Return a Book\n";
         cout << "4. View Overdue Payments\n";
         cout << "5. Pay Overdue Fees\n";
+        cout << "6. Export Library Report\n";
+        cout << "7. View Loan History\n";
         cout << "0. Logout\n";
 
-        choice = inputInt("Enter your choice: ", 0, 5);
+        choice = inputInt("Enter your choice: ", 0, 7);
 
         switch (choice) {
         case 1: bookCatalogueMenu(); break;
@@ -709,6 +1742,8 @@ void mainMenu() {
         case 3: returnBook(); break;
         case 4: viewOverduePayments(); break;
         case 5: payOverdue(); break;
+        case 6: exportLibraryReport(); break;
+        case 7: viewLoanHistory(); break;
         case 0:
             currentUser.clear();
             cout << "Logged out successfully!\n";
@@ -725,16 +1760,20 @@ int main() {
     loadMeta();
     loadBooks();
     loadLoans();
+    loadArchiveIndex();
+    archiveOldLoans();
     loadUsers();
 
     syncAllUserActiveLoans();
-    saveUsers();
 
     // ensure user activeLoans counters are consistent with loans
     for (auto& u : users) {
         u.activeLoans = getUserActiveLoansCount(u.  username);
     }
-    saveUsers();
+    userVersions.touchFrom(0);
+    commitChanges(DIRTY_USERS);
+    startPersistence();
+    startCoBorrowRebuild(); // decodes the archive in the background
 
     int choice;
     do {
@@ -761,6 +1800,17 @@ int main() {
             pressEnterToContinue();
         }
     } while (choice != 0);
-    persistAll();
+    if (reportWorker.joinable()) reportWorker.join();
+    stopCoBorrowRebuild();
+    archiveOldLoans();
+    shutdownPersistence();
+
+    if (flushStats.tableWrites > 0) {
+        cout << "Saved " << flushStats.tableMarks << " table changes with " << flushStats.tableWrites
+            << " file writes (" << fixed << setprecision(1)
+            << (double)flushStats.tableMarks / flushStats.tableWrites << "x coalescing); flush latency avg "
+            << setprecision(2) << flushStats.totalMs / flushStats.flushes << " ms, max "
+            << flushStats.maxMs << " ms\n";
+    }
     return 0;
 }
\ No newline at end of file